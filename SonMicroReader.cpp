@@ -31,46 +31,209 @@ SonMicroReader::SonMicroReader()
 	tagType = 0;               		// the type of tag
 	errorCode = 0;             		// error code from some commands
 	antennaPower = 1;          		// antenna power level
+	startupTime = 0;           		// ms from reset until the reader answered
+	transport = &wireTransport;		// talk to the reader over I2C
+	recorder = NULL;           		// don't record
+	idleCallback = NULL;       		// delay() while waiting
+	idleTime = 0;              		// ms given to idleCallback
 	version = "";
 	payloadString.reserve(BLOCK_SIZE);
+	memset(&selectResult, 0, sizeof(selectResult));
+	selectResult.status = SM13X_STATUS_NO_TAG;
+	memset(&readResult, 0, sizeof(readResult));
+	memset(&authResult, 0, sizeof(authResult));
+	madUidLength = 0;
+	eventStart = 0;
+	eventCount = 0;
+	eventsDropped = 0;
 }
 
 
 void SonMicroReader::begin(void)
 {
   Wire.begin();
-  reset();
-  delay(2000);
+  waitForReader();
 }
 
 
 void SonMicroReader::begin(int address)
 {
   Wire.begin((uint8_t)address);		// allows user to send in I2C address
+  waitForReader();
+}
+
+// Resets the reader, then asks for the firmware version
+// until the reader answers, or until STARTUP_TIMEOUT has passed.
+// This replaces a fixed two-second wait after reset;
+// the version is kept for getFirmwareVersion():
+
+void SonMicroReader::waitForReader()
+{
+  unsigned long start = millis();
+  version = "";
   reset();
+  do {
+    sendCommand(SM13X_GET_FIRMWARE);
+    getData();
+  } while (version.length() == 0 && millis() - start < STARTUP_TIMEOUT);
+  startupTime = millis() - start;
 }
 
 
-// Retrieve a response from the reader
-// from any command:
+// Sends a command packet to the reader over I2C:
+//
 
-int SonMicroReader::getData() 
-{   
+void SM13XWire::send(const byte* packet, int length)
+{
+  Wire.beginTransmission(SM13X_ADDRESS); 
+  Wire.write(packet, length);
+  Wire.endTransmission();      // end the I2C connection
+}
+
+// Gets a response from the reader over I2C.
+// Returns the number of bytes received, 0 if none:
+
+int SM13XWire::receive(byte* buffer, int length)
+{
   int count = 0;
-  // The reader can't respond in less than
-  // 50 ms:
-  delay(50);
-  // get response from reader:
-  Wire.requestFrom(0x42, BUFFER_SIZE);
-  while (!Wire.available()) if (DEBUG) Serial.print(".");
+  // requestFrom() doesn't return until the bytes are in,
+  // so there's no need to wait for Wire.available():
+  if (Wire.requestFrom(SM13X_ADDRESS, length) == 0) {
+    return 0;
+  }
   // while data is coming from the reader,
   // add it to the response buffer:
-  while(Wire.available())  {     
-    responseBuffer[count] = Wire.read();  
+  while(Wire.available() && count < length)  {     
+    buffer[count] = Wire.read();  
     count++;
   }  
-  // put a 0 in the last byte after the response:
-  responseBuffer[count] = 0;
+  return count;
+}
+
+
+SM13XReplay::SM13XReplay(Stream& thisLog) : log(thisLog)
+{
+  waitTime = 0;
+  mismatches = 0;
+  skipCommands = false;
+}
+
+// Skips the recorded commands instead of checking them, so you can
+// call getData() over and over to step through every response:
+//
+
+void SM13XReplay::setSkipCommands(boolean skip)
+{
+  skipCommands = skip;
+}
+
+// Sets how long to wait before each response, to play back
+// at the reader's speed rather than as fast as possible:
+//
+
+void SM13XReplay::setResponseTime(int ms)
+{
+  waitTime = ms;
+}
+
+// Commands aren't sent anywhere when replaying. Instead, each one
+// is checked against the next command in the log, and counted in
+// getMismatches() if it's different. Responses to commands that
+// weren't sent this time are skipped:
+
+void SM13XReplay::send(const byte* packet, int length)
+{
+  if (skipCommands) {
+    return;
+  }
+  byte header[RECORD_HEADER_SIZE];
+  while (log.peek() == 'R') {
+    mismatches++;
+    if (!readRecord(header, NULL, 0)) {
+      return;
+    }
+  }
+  if (log.peek() != 'S') {
+    mismatches++;
+    return;
+  }
+  byte recorded[BUFFER_SIZE];
+  int count = readRecord(header, recorded, BUFFER_SIZE);
+  if (header[RECORD_HEADER_SIZE - 1] != length || 
+      memcmp(recorded, packet, count) != 0) {
+    mismatches++;
+  }
+}
+
+// Gets the next recorded response from the log. If it's longer
+// than length, you get the first length bytes, as from the reader.
+// Returns the number of bytes, 0 for an empty response, or at the
+// end of the log. If the log has a command next instead, that's
+// a mismatch, and it's left for the next send():
+
+int SM13XReplay::receive(byte* buffer, int length)
+{
+  byte header[RECORD_HEADER_SIZE];
+  while (skipCommands && log.peek() == 'S') {
+    readRecord(header, NULL, 0);
+  }
+  if (log.peek() != 'R') {
+    if (log.peek() == 'S') mismatches++;
+    return 0;
+  }
+  return readRecord(header, buffer, length);
+}
+
+// Reads one record's header, and up to length bytes of its packet
+// into buffer, skipping the rest. Returns the number of bytes
+// put in buffer:
+
+int SM13XReplay::readRecord(byte* header, byte* buffer, int length)
+{
+  if (log.readBytes(header, RECORD_HEADER_SIZE) != RECORD_HEADER_SIZE) {
+    return 0;
+  }
+  int count = header[RECORD_HEADER_SIZE - 1];
+  int kept = (count < length) ? count : length;
+  if (kept > 0 && (int)log.readBytes(buffer, kept) != kept) {
+    return 0;
+  }
+  // skip the rest:
+  for (int i = kept; i < count; i++) {
+    byte skipped;
+    log.readBytes(&skipped, 1);
+  }
+  return kept;
+}
+
+
+// Table of response decoders, keyed by command.
+// Commands that only return a status byte (write block,
+// write value block, write master key, set baud rate and so forth)
+// don't need an entry; their status is left in errorCode.
+// To decode a new command, add its decoder here:
+
+const SonMicroReader::ResponseDecoder SonMicroReader::decoders[] = {
+  { SM13X_GET_FIRMWARE, &SonMicroReader::decodeFirmware },
+  { SM13X_SEEK, &SonMicroReader::decodeTag },
+  { SM13X_SELECT, &SonMicroReader::decodeTag },
+  { SM13X_AUTHENTICATE, &SonMicroReader::decodeAuth },
+  { SM13X_READ, &SonMicroReader::decodeRead },
+  { SM13X_SET_ANTENNA_POWER, &SonMicroReader::decodeAntenna }
+};
+
+
+// Retrieve a response from the reader
+// from any command:
+
+int SonMicroReader::getData() 
+{   
+  int count = receiveResponse(BUFFER_SIZE);
+  // no response at all means the reader isn't there,
+  // or isn't ready yet:
+  if (count == 0) {
+    return 0;
+  }
 
   // fill in the global variables:
   packetLength = responseBuffer[0];
@@ -82,194 +245,116 @@ int SonMicroReader::getData()
   // if packet length is 2, you have only a command and an error code:
   if (packetLength < 3) {
     errorCode = responseBuffer[2];
-    tagType = 0;
-    tagNumber = 0;
   } 
 
-  // some messages generate error codes.  Return them here.
-  switch (command) {
-    // reset produces nothing as of version 2.8 of the SM130 firmware:
-  case 0x80:
-    break;
-    // firmware version only produces the firmware version:
-  case 0x81: 
-    errorCode = 0;
-    tagType = 0;
-    tagNumber = 0;
-       // if you got a good payload, it's the version number
-    // add the response to the string:
-    if (packetLength > 2) {
- 	version = ""; // clear the version string
-      int i = 2;
-      while (isPrintable(responseBuffer[i])) {
-        version += (char)responseBuffer[i];
-        i++;
-      }
-    }
-    break;
-  case 0x82:  // seekTag    
-    if (errorCode == 0x55) {
-      //Reader error: Antenna is off
-    }
-    if (errorCode == 0x4C) {
-      //Command in Progress
-    }
-    // if you got a good payload, it's a tag number:
-    if (packetLength > 2) {
-      // get the tag type:
-      tagType = responseBuffer[2];
-      // tag bytes come in reverse order:
-      for (int thisByte = packetLength; thisByte >= 3; thisByte--) {
-        // shift the current byte up one byte:
-        tagNumber = tagNumber << 8;
-        // add the new byte to the end of the tag:
-        tagNumber += responseBuffer[thisByte]; 
-      }
-    }
-    break;
-  case 0x83:  // selectTag
-    switch(errorCode) {
-    case 0x4E:
-      // Reader error: No Tag present
-      break;
-    case 0x55:
-      // Reader error: Access failed because RF field is off
-      break;
-    }
-    // if you got a good payload, it's a tag number:
-    if (packetLength > 2) {
-      // get the tag type:
-      tagType = responseBuffer[2];
-      // tag bytes come in reverse order:
-      for (int thisByte = packetLength; thisByte >= 3; thisByte--) {
-        // shift the current byte up one byte:
-        tagNumber = tagNumber << 8;
-        // add the new byte to the end of the tag:
-        tagNumber += responseBuffer[thisByte]; 
-      }
-    }
-    break;
-  case 0x85:  //authenticate
-    switch(errorCode) {
-    case 0x45:
-      // Reader error: Invalid key format in EEPROM
-      break;
-    case 0x4C:
-      // Login successful
-      break;
-    case 0x4E:
-      // Reader error: No tag present, or login failed
-      break;
-    case 0x55:
-      //Reader error: login failed
-      break;
-    }
-    break;
-  case 0x86:  //read block
-    switch(errorCode) {
-    case 00:
-      // good read
-      for (int i=0; i<count-1; i++) {
-      	// payload starts at fourth byte of response:
-      	payload[i] = responseBuffer[i+3];
-      }
-      break;
-    case 0x4E:
-      // Reader error: no tag present
-      break;
-    case 0x46:
-      // Reader error: read failed
-      break;
-    }
-    break; 
-  case 0x87:  //read value block
-    switch(errorCode) {
-    case 0x4E:
-      // Reader error: no tag present
-      break;
-    case 0x46:
-      // Reader error: read failed
-      break;
-    case 0x49:
-      // Reader error: you tried to read a block number that isn't a value block
-      break;
-    }
-    break; 
-  case 0x89:  //write  block
-    switch(errorCode) {
-    case 0x55:
-      // Reader error: data read doesn't match data write
-      break;
-    case 0x58:
-      // Reader error: the block you tried to write to is protected
-      break;
-    case 0x4E:
-      // Reader error: no tag present
-      break;
-    case 0x46:
-      // Reader error: write failed
-      break;
-    }
-    break; 
-  case 0x8A:  //write value block
-    switch(errorCode) {
-    case 0x4E:
-      // Reader error: no tag present
-      break;
-    case 0x46:
-      // Reader error: read failed during verification
-      break;
-    case 0x49:
-      // Reader error: you tried to write to a block number that isn't a value block
-      break;
-    }
-    break; 
-  case 0x8B:  //write  4 byte block
-    switch(errorCode) {
-    case 0x55:
-      // Reader error: data read doesn't match data write
-      break;
-    case 0x58:
-      // Reader error: the block you tried to write to is protected
-      break;
-    case 0x4E:
-      // Reader error: no tag present
-      break;
-    case 0x46:
-      // Reader error: write failed
-      break;
-    }
-    break; 
-  case 0x8C:  //write master key
-    switch(errorCode) {
-    case 0x4E:
-      // Reader error: write master key failed
-      break;
-    case 0x4C:
-      // success!
+  // find the decoder for this command, if there is one:
+  for (unsigned int i = 0; i < sizeof(decoders) / sizeof(decoders[0]); i++) {
+    if (decoders[i].command == command) {
+      (this->*decoders[i].decode)();
       break;
     }
-    break; 
-  case 0x90:     // set antenna status
-    errorCode = 0;
-    antennaPower = responseBuffer[2];
-    break;
-  case 0x94:  //set baud rate
-    switch(errorCode) {
-    case 0x4E:
-      // Reader error: set baud rate failed
-      break;
-    case 0x4C:
-      // success!
-      // Baud rate set";
-      break;
-    }
-    break; 
-  } 
+  }
   // return the length of the response:
   return count;
 }
 
+// waits for the reader, then reads up to length bytes
+// of its response into the response buffer:
+
+int SonMicroReader::receiveResponse(int length)
+{
+  // wait until the reader can respond:
+  wait(transport->responseTime());
+  // get response from reader:
+  int count = transport->receive(responseBuffer, length);
+  // record empty responses too, so the replay stays in step:
+  if (recorder) record('R', responseBuffer, count);
+  return count;
+}
+
+// firmware version only produces the firmware version:
+//
+
+void SonMicroReader::decodeFirmware()
+{
+  errorCode = 0;
+  // if you got a good payload, it's the version number
+  // add the response to the string:
+  if (packetLength > 2) {
+    version = ""; // clear the version string
+    for (int i = 2; i <= packetLength && i < BUFFER_SIZE && isPrintable(responseBuffer[i]); i++) {
+      version += (char)responseBuffer[i];
+    }
+  }
+}
+
+// seek and select produce a tag type and number,
+// or an error code (0x4E no tag, 0x55 RF field is off,
+// 0x4C seek in progress):
+
+void SonMicroReader::decodeTag()
+{
+  selectResult.tagNumber = 0;
+  selectResult.uidLength = 0;
+  if (packetLength < 3) {
+    selectResult.status = (SM13XStatus)errorCode;
+    selectResult.tagType = 0;
+    recordEvent();
+    return;
+  }
+  // if you got a good payload, it's a tag number:
+  selectResult.status = SM13X_STATUS_OK;
+  // get the tag type:
+  selectResult.tagType = responseBuffer[2];
+  // the UID follows the tag type:
+  int uidLength = packetLength - 2;
+  if (uidLength > UID_SIZE) uidLength = UID_SIZE;
+  selectResult.uidLength = uidLength;
+  // tag bytes come in reverse order:
+  for (int thisByte = uidLength - 1; thisByte >= 0; thisByte--) {
+    selectResult.uid[thisByte] = responseBuffer[thisByte + 3];
+    // shift the current byte up one byte,
+    // and add the new byte to the end of the tag:
+    selectResult.tagNumber = (selectResult.tagNumber << 8) + responseBuffer[thisByte + 3];
+  }
+  tagType = selectResult.tagType;
+  tagNumber = selectResult.tagNumber;
+  recordEvent();
+}
+
+// authenticate produces 0x4C on success,
+// 0x4E (no tag or login failed), 0x55 (login failed)
+// or 0x45 (invalid key format in EEPROM) on failure:
+
+void SonMicroReader::decodeAuth()
+{
+  authResult.status = (SM13XStatus)responseBuffer[2];
+}
+
+// read block produces the 16 bytes of the block,
+// or 0x4E (no tag) or 0x46 (read failed):
+
+void SonMicroReader::decodeRead()
+{
+  if (packetLength < 3) {
+    readResult.status = (SM13XStatus)errorCode;
+    return;
+  }
+  // good read. Payload starts at fourth byte of response:
+  readResult.status = SM13X_STATUS_OK;
+  readResult.block = responseBuffer[2];
+  memcpy(readResult.data, responseBuffer + 3, BLOCK_SIZE);
+}
+
+// set antenna power produces the new antenna status:
+//
+
+void SonMicroReader::decodeAntenna()
+{
+  errorCode = 0;
+  antennaPower = responseBuffer[2];
+}
+
 
 // This method sends a command to the 
 // RFID readers via I2C. This function is 
@@ -291,20 +376,23 @@ void SonMicroReader::sendCommand(int thisCommand)
 
 void SonMicroReader::sendCommand(int command[], int length) 
 {
-  Wire.beginTransmission(0x42); 
+  byte packet[BUFFER_SIZE];
+  int count = 0;
+  if (length > BUFFER_SIZE - 2) length = BUFFER_SIZE - 2;
   int checksum = length;       // Starting value for the checksum.
-  Wire.write(length);          // send the length
+  packet[count++] = length;    // send the length
 
     for (int i = 0; i < length; i++) {
     checksum += command[i];    // Add each byte to the checksum
-    Wire.write(command[i]);    // send the byte
+    packet[count++] = command[i];    // send the byte
   }
 
   // checksum is the low byte of the sum of 
   // the other bytes:
   checksum = checksum % 256; 
-  Wire.write(checksum);        // send the checksum
-  Wire.endTransmission();      // end the I2C connection
+  packet[count++] = checksum;  // send the checksum
+  transport->send(packet, count);
+  if (recorder) record('S', packet, count);
 
     // you just sent a new command, so there's no new data available:
 
@@ -312,6 +400,131 @@ void SonMicroReader::sendCommand(int command[], int length)
   clearValues();
 }
 
+/**
+ * Checks that a tag is still on the reader. This sends a select,
+ * but only reads as many bytes of the response as the tag's UID
+ * needs, and doesn't decode it, clear the other results, or log it
+ * as an event.
+ *
+ * @param tag   the tag to look for, e.g. from getSelectResult()
+ * @return  true if the same tag is still there. If not, getErrorCode()
+ *          is SM13X_STATUS_NO_TAG when no tag is there, and 0 when there
+ *          might be a different tag, which needs a selectTag() to read.
+ */
+
+boolean SonMicroReader::confirmTag(const SelectResult& tag)
+{
+  errorCode = 0;
+  if (tag.uidLength == 0) {
+    return false;
+  }
+  // a select, with its length and checksum:
+  const byte packet[] = {
+    1, SM13X_SELECT, 1 + SM13X_SELECT  };
+  transport->send(packet, sizeof(packet));
+  if (recorder) record('S', packet, sizeof(packet));
+
+  // length, command, tag type, UID and checksum:
+  int expected = tag.uidLength + 4;
+  int count = receiveResponse(expected);
+  if (count < 3) {
+    return false;
+  }
+  if (responseBuffer[0] < 3) {
+    errorCode = responseBuffer[2];
+    return false;
+  }
+  return count == expected &&
+    responseBuffer[0] == tag.uidLength + 2 &&
+    responseBuffer[1] == SM13X_SELECT &&
+    responseBuffer[2] == tag.tagType &&
+    memcmp(responseBuffer + 3, tag.uid, tag.uidLength) == 0;
+}
+
+
+SM13XPresence::SM13XPresence(SonMicroReader& thisReader) : reader(thisReader)
+{
+  present = false;
+  arrivalPending = false;
+  debounce = 250;
+  lastSeen = 0;
+  memset(&tag, 0, sizeof(tag));
+  memset(&pendingTag, 0, sizeof(pendingTag));
+}
+
+// Sets how long a tag has to be gone before update()
+// reports that it departed, in ms:
+//
+
+void SM13XPresence::setDebounce(unsigned long ms)
+{
+  debounce = ms;
+}
+
+/**
+ * Checks for a tag, and reports any change. While a tag is present,
+ * this only confirms it with SonMicroReader::confirmTag(), and only
+ * does a full selectTag() when a different tag might be there.
+ *
+ * @return  PRESENCE_ARRIVED when a tag is first seen; getTag() has its details.
+ *          PRESENCE_DEPARTED when it's been gone for the debounce time,
+ *          or when a different tag replaced it. The new tag's
+ *          PRESENCE_ARRIVED comes from the next update().
+ *          PRESENCE_NONE otherwise.
+ */
+
+int SM13XPresence::update()
+{
+  // a different tag was selected last time:
+  if (arrivalPending) {
+    arrivalPending = false;
+    present = true;
+    tag = pendingTag;
+    lastSeen = millis();
+    return PRESENCE_ARRIVED;
+  }
+
+  if (!present) {
+    reader.selectTag();
+    if (reader.getSelectResult().status == SM13X_STATUS_OK) {
+      present = true;
+      tag = reader.getSelectResult();
+      lastSeen = millis();
+      return PRESENCE_ARRIVED;
+    }
+    return PRESENCE_NONE;
+  }
+
+  if (reader.confirmTag(tag)) {
+    lastSeen = millis();
+    return PRESENCE_NONE;
+  }
+
+  // something's there, but maybe not the same tag:
+  if (reader.getErrorCode() != SM13X_STATUS_NO_TAG) {
+    reader.selectTag();
+    const SelectResult& current = reader.getSelectResult();
+    if (current.status == SM13X_STATUS_OK) {
+      if (current.uidLength == tag.uidLength && 
+          memcmp(current.uid, tag.uid, tag.uidLength) == 0) {
+        lastSeen = millis();
+        return PRESENCE_NONE;
+      }
+      // a different tag: report this one gone, and the new one next time:
+      present = false;
+      pendingTag = current;
+      arrivalPending = true;
+      return PRESENCE_DEPARTED;
+    }
+  }
+
+  if (millis() - lastSeen >= debounce) {
+    present = false;
+    return PRESENCE_DEPARTED;
+  }
+  return PRESENCE_NONE;
+}
+
 //	return the last command sent
 //
 
@@ -393,14 +606,17 @@ void SonMicroReader::reset()
 }
 
 /**
- * gets the firmware of the reader
+ * gets the firmware of the reader. It's read once by begin(),
+ * and only asked for again if the reader didn't answer then.
  *
  */
 String SonMicroReader::getFirmwareVersion() 
 {
-  sendCommand(SM13X_GET_FIRMWARE);
-  // wait for a response:
-  getData();
+  if (version.length() == 0) {
+    sendCommand(SM13X_GET_FIRMWARE);
+    // wait for a response:
+    getData();
+  }
   return version;
 }
 
@@ -412,6 +628,10 @@ String SonMicroReader::getFirmwareVersion()
 void SonMicroReader::seekTag() 
 {
   sendCommand(SM13X_SEEK);
+  // no tag, unless the reader says otherwise:
+  selectResult.status = SM13X_STATUS_NO_TAG;
+  selectResult.uidLength = 0;
+  selectResult.tagType = 0;
   getData();
 }
 
@@ -423,6 +643,10 @@ void SonMicroReader::seekTag()
 unsigned long SonMicroReader::selectTag() 
 {
   sendCommand(SM13X_SELECT);
+  // no tag, unless the reader says otherwise:
+  selectResult.status = SM13X_STATUS_NO_TAG;
+  selectResult.uidLength = 0;
+  selectResult.tagType = 0;
   getData();
   return tagNumber;
 }
@@ -439,19 +663,25 @@ boolean SonMicroReader::authenticate(int thisBlock)
     thisBlock,
     0xFF  		  // default encryption
   };  
-  int key[] = {0};
+  int key[] = {0, 0, 0, 0, 0, 0};
   return authenticate(thisBlock, 0xFF, key);
 }
 
 
 boolean SonMicroReader::authenticate(int thisBlock, int authentication) 
 {
-  int key[] = {0};
+  int key[] = {0, 0, 0, 0, 0, 0};
    return authenticate(thisBlock, authentication, key);
 }
 
 boolean SonMicroReader::authenticate(int thisBlock, int authentication, int* thisKey) 
 {
+  // Ultralight tags have no keys, so there's nothing to log in to:
+  if (selectResult.tagType == SM13X_TAG_ULTRALIGHT) {
+    authResult.status = SM13X_STATUS_SUCCESS;
+    authResult.block = thisBlock;
+    return true;
+  }
   int length = 9;
   int command[length];
   command[0] = SM13X_AUTHENTICATE,  // authenticate
@@ -465,11 +695,13 @@ boolean SonMicroReader::authenticate(int thisBlock, int authentication, int* thi
   sendCommand(command, length);
 
   // wait for a response:
+  authResult.status = SM13X_STATUS_FAILED;
+  authResult.block = thisBlock;
   getData();
 
   // response 0x4C (ASCII L) means
   // you successfully authenticated
-  if (responseBuffer[2] == 0x4C) {
+  if (authResult.status == SM13X_STATUS_SUCCESS) {
     return true;
   } 
   else {
@@ -481,7 +713,8 @@ boolean SonMicroReader::authenticate(int thisBlock, int authentication, int* thi
 
 
 // Read a block. You need to authenticate() 
- // before you can call this.
+ // before you can call this. On Ultralight tags,
+ // block is a page number, and you get four pages.
   
  int SonMicroReader::readBlock(int block) 
  {
@@ -493,16 +726,13 @@ boolean SonMicroReader::authenticate(int thisBlock, int authentication, int* thi
 	 // send the command:
 	 sendCommand(command, length);  
 	 // get 20 bytes (3 response + 16 bytes data + checksum)
+	 readResult.status = SM13X_STATUS_FAILED;
 	 int count = getData();  
-	 // response 0x4E (ASCII N) means no tag:
-	 if (responseBuffer[2] == 0x4E) { 
-	 	return 0;
-	 } 
+	 // response 0x4E (ASCII N) means no tag,
 	 // response 0x46 (ASCII F) means read failed:
-	 else if (responseBuffer[2] == 0x46) {
+	 if (readResult.status != SM13X_STATUS_OK) { 
 	 	return 0;
-	 }
-	 
+	 } 
 		
 	 return count;
  }
@@ -514,8 +744,8 @@ boolean SonMicroReader::authenticate(int thisBlock, int authentication, int* thi
 String& SonMicroReader::getString()
 {
 	 payloadString = "";
-	for(int i=0; i < 16; i++) {
-		char thisChar = payload[i];
+	for(int i=0; i < BLOCK_SIZE; i++) {
+		char thisChar = readResult.data[i];
 		if (thisChar !=0) {
 			payloadString += thisChar;      
 		}
@@ -554,42 +784,74 @@ void SonMicroReader::writeBlock(int thisBlock, String thisMessage)
 }
 
 /**
- * Writes a 4-byte string to a block. If the string is less than 16 bytes
- * it fills the empty bytes with 0x00.  If more than 4 bytes, it generates
- * an error message.
- * Used for Mifare ultralight tags
+ * Writes a 4-byte string to a page. If the string is less than 4 bytes
+ * it fills the empty bytes with 0x00.  If more than 4 bytes, it
+ * doesn't write anything and returns false.
+ * Used for Mifare ultralight tags, which don't need authentication.
  * 
- * You need to select and authenticate before ou can read or write.
+ * You need to select before you can read or write.
  * 
- * @param thisBlock     Block to write to
+ * @param thisBlock     Page to write to
  * @param thisMessage   4-byte string to write
-
-  Not implemented yet.  Still need to convert from Java 
-
+ * @return  true if the reader wrote the page
  */
  
-void SonMicroReader::writeFourByteBlock(int thisBlock, String thisMessage) 
+boolean SonMicroReader::writeFourByteBlock(int thisBlock, String thisMessage) 
 {
-  //  // block needs to be broken into 4-byte sections
-  //  if (thisMessage.length() > 4) {
-  //    // You can't send more than 4 bytes with a writeFourByteBlock() command.";
-  //  } 
-  //  else {
-  //    int thisCommand[] = {
-  //      0x8B,thisBlock                                                                                   }; 
-  //    int thisByte;
-  //    // make sure to write to all 4 bytes:
-  //    for (int i = 0; i < 4; i++) {
-  //      if (i < thisMessage.length()) {
-  //        thisByte = (int)thisMessage.charAt(i);
-  //      } 
-  //      else {
-  //        thisByte = 0;
-  //      }
-  //      thisCommand = parent.append(thisCommand, thisByte);
-  //    } 
-  //    sendCommand(thisCommand);
-  //  }
+  // You can't send more than 4 bytes with a writeFourByteBlock() command:
+  if (thisMessage.length() > SM13X_PAGE_SIZE) {
+    return false;
+  }
+  int length = 2 + SM13X_PAGE_SIZE;
+  int command[length];
+  command[0] = SM13X_WRITE_FOUR_BYTE;
+  command[1] = thisBlock;
+  // make sure to write to all 4 bytes:
+  for (int i = 0; i < SM13X_PAGE_SIZE; i++) {
+    if (i < (int)thisMessage.length()) {
+      command[i+2] = (byte)thisMessage.charAt(i);
+    } 
+    else {
+      command[i+2] = 0;
+    }
+  }
+  sendCommand(command, length);
+  getData();
+  // the reader echoes the page and data back on success,
+  // or sends an error code (0x4E, 0x46, 0x55, 0x58) on failure:
+  return packetLength > 2;
+}
+
+/**
+ * Reads the first length bytes of a Mifare Ultralight into buffer,
+ * starting at page 0. Each read returns four pages, so a 64-byte
+ * Ultralight takes four reads. Larger cards (Ultralight C, NTAG)
+ * can be read by passing a larger length.
+ *
+ * You need to select before you can read. No authentication is done.
+ *
+ * @param buffer  where to put the card's contents
+ * @param length  how many bytes to read
+ * @return  the number of bytes read, which is less than length
+ *          if a read failed, or 0 if the tag isn't an Ultralight
+ */
+
+int SonMicroReader::dumpUltralight(byte* buffer, int length)
+{
+  int total = 0;
+  if (selectResult.tagType != SM13X_TAG_ULTRALIGHT) {
+    return 0;
+  }
+  for (int page = 0; total < length; page += BLOCK_SIZE / SM13X_PAGE_SIZE) {
+    if (readBlock(page) == 0) {
+      break;
+    }
+    int count = length - total;
+    if (count > BLOCK_SIZE) count = BLOCK_SIZE;
+    memcpy(buffer + total, readResult.data, count);
+    total += count;
+  }
+  return total;
 }
 
 /**
@@ -647,6 +909,342 @@ void SonMicroReader::setBaudRate(int baudRate)
   getData();
 }
 
+/**
+ * Mifare Classic sector geometry. Classic 1K tags, and the first
+ * 32 sectors of Classic 4K tags, have four blocks per sector.
+ * The last eight sectors of a Classic 4K (blocks 128 and up)
+ * have sixteen blocks. The last block of each sector is the
+ * sector trailer, which holds the keys.
+ *
+ * These use the tag type from the last selectTag() or seekTag().
+ */
+
+int SonMicroReader::getSector(int block)
+{
+  if (selectResult.tagType == SM13X_TAG_CLASSIC_4K && block >= 128) {
+    return 32 + (block - 128) / 16;
+  }
+  return block / 4;
+}
+
+int SonMicroReader::getSectorStart(int sector)
+{
+  if (selectResult.tagType == SM13X_TAG_CLASSIC_4K && sector >= 32) {
+    return 128 + (sector - 32) * 16;
+  }
+  return sector * 4;
+}
+
+int SonMicroReader::getSectorSize(int sector)
+{
+  if (selectResult.tagType == SM13X_TAG_CLASSIC_4K && sector >= 32) {
+    return 16;
+  }
+  return 4;
+}
+
+boolean SonMicroReader::isSectorTrailer(int block)
+{
+  // Ultralight tags have pages, not sectors:
+  if (selectResult.tagType == SM13X_TAG_ULTRALIGHT) {
+    return false;
+  }
+  int sector = getSector(block);
+  return block == getSectorStart(sector) + getSectorSize(sector) - 1;
+}
+
+/**
+ * Lists the sectors that the Mifare Application Directory (MAD)
+ * marks as NDEF sectors. The MAD is in sector 0, and for
+ * Classic 4K tags also in sector 16. It's read using the public
+ * MAD key and checked against its CRC. The result, including a tag
+ * having no MAD, is cached until a tag with a different UID is selected.
+ *
+ * You need to select before you can call this.
+ *
+ * @param sectors     where to put the sector numbers, in order
+ * @param maxSectors  the most sector numbers to put in sectors
+ * @return  the number of NDEF sectors, or 0 if the MAD couldn't be read
+ */
+
+int SonMicroReader::findNDEFSectors(byte* sectors, int maxSectors)
+{
+  // only Mifare Classic tags have a MAD:
+  if (selectResult.tagType != SM13X_TAG_CLASSIC_1K && 
+      selectResult.tagType != SM13X_TAG_CLASSIC_4K) {
+    return 0;
+  }
+  // use the cached MAD if it's from this tag:
+  if (madUidLength != selectResult.uidLength || 
+      memcmp(madUid, selectResult.uid, madUidLength) != 0) {
+    if (!readMAD()) {
+      return 0;
+    }
+  }
+  int count = 0;
+  for (int sector = 1; sector < MAX_SECTORS && count < maxSectors; sector++) {
+    if (madSectors[sector / 8] & (1 << (sector % 8))) {
+      sectors[count] = sector;
+      count++;
+    }
+  }
+  return count;
+}
+
+// reads the MAD from the selected tag and caches it:
+//
+
+boolean SonMicroReader::readMAD()
+{
+  madUidLength = 0;
+  memset(madSectors, 0, sizeof(madSectors));
+  if (selectResult.uidLength == 0) {
+    return false;
+  }
+  // MAD1 is in blocks 1 and 2, for sectors 1 to 15.
+  // If the tag is still there after a failed login or read,
+  // it has no MAD, so that's cached too:
+  boolean hasMAD = readMADSector(1, 2, 1);
+  if (!hasMAD && !wakeTag()) {
+    return false;
+  }
+  memcpy(madUid, selectResult.uid, selectResult.uidLength);
+  madUidLength = selectResult.uidLength;
+
+  // MAD2 is in blocks 64 to 66, for sectors 17 to 39, on Classic 4K
+  // tags whose general purpose byte (byte 9 of the sector 0 trailer)
+  // says MAD version 2:
+  if (hasMAD && selectResult.tagType == SM13X_TAG_CLASSIC_4K) {
+    byte mad1Sectors[sizeof(madSectors)];
+    memcpy(mad1Sectors, madSectors, sizeof(madSectors));
+    if (readBlock(3) == 0) {
+      wakeTag();
+    } 
+    else if ((readResult.data[9] & 0x03) == 0x02 && !readMADSector(64, 3, 17)) {
+      // keep the MAD1 entries:
+      memcpy(madSectors, mad1Sectors, sizeof(madSectors));
+      wakeTag();
+    }
+  }
+  return true;
+}
+
+// reads the application IDs in one MAD sector. The first two bytes
+// are the CRC and info byte; after that, each sector has a two-byte
+// application ID: the application code, then the function cluster.
+// The entries are only used if the CRC matches.
+// Returns false if the login or a read failed:
+
+boolean SonMicroReader::readMADSector(int firstBlock, int blockCount, int firstSector)
+{
+  int madKey[] = {
+    0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5  };
+  byte mad[3 * BLOCK_SIZE];
+  if (!authenticate(firstBlock, SM13X_KEY_A, madKey)) {
+    return false;
+  }
+  for (int i = 0; i < blockCount; i++) {
+    if (readBlock(firstBlock + i) == 0) {
+      return false;
+    }
+    memcpy(mad + i * BLOCK_SIZE, readResult.data, BLOCK_SIZE);
+  }
+  // CRC-8 of everything after the CRC byte, polynomial 0x1D, preset 0xC7:
+  int length = blockCount * BLOCK_SIZE;
+  byte crc = 0xC7;
+  for (int i = 1; i < length; i++) {
+    crc ^= mad[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1;
+    }
+  }
+  if (crc != mad[0]) {
+    return true;
+  }
+  int sector = firstSector;
+  for (int i = 2; i < length; i += 2, sector++) {
+    unsigned int aid = (mad[i+1] << 8) | mad[i];
+    if (aid == NDEF_AID) {
+      madSectors[sector / 8] |= 1 << (sector % 8);
+    }
+  }
+  return true;
+}
+
+// selects the tag again after a failed login or read has halted it.
+// Returns true if the same tag is still there:
+
+boolean SonMicroReader::wakeTag()
+{
+  byte uid[UID_SIZE];
+  byte uidLength = selectResult.uidLength;
+  memcpy(uid, selectResult.uid, uidLength);
+  selectTag();
+  return selectResult.status == SM13X_STATUS_OK &&
+    selectResult.uidLength == uidLength &&
+    memcmp(selectResult.uid, uid, uidLength) == 0;
+}
+
+/**
+ * Records every command packet sent and every response received
+ * to log, e.g. an SD card File or Serial. Each record is:
+ *   'S' (sent) or 'R' (received), millis() (4 bytes, low byte first),
+ *   number of bytes, the bytes.
+ * A response with no bytes is recorded as an 'R' with 0 bytes.
+ * Pass the log to an SM13XReplay to play it back.
+ *
+ * @param log   where to record, or NULL to stop recording
+ */
+
+void SonMicroReader::setRecorder(Print* log)
+{
+  recorder = log;
+}
+
+/**
+ * Sets where commands go and responses come from. By default
+ * that's the reader, over I2C. Pass an SM13XReplay to play back
+ * a recording instead, or NULL to go back to the reader.
+ */
+
+void SonMicroReader::setTransport(SM13XTransport* thisTransport)
+{
+  if (thisTransport == NULL) {
+    transport = &wireTransport;
+  } 
+  else {
+    transport = thisTransport;
+  }
+}
+
+/**
+ * Sets a function for the library to call over and over while it
+ * waits for the reader, e.g. for the 50 ms before each response.
+ * It's passed the number of ms left in the wait, and should
+ * return quickly, well within that time.
+ *
+ * The callback must not call back into the same SonMicroReader:
+ * that would overwrite the response buffer and the results of the
+ * command that's still waiting for its response.
+ *
+ * @param callback  the function to call, or NULL to just delay()
+ */
+
+void SonMicroReader::setIdleCallback(IdleCallback callback)
+{
+  idleCallback = callback;
+}
+
+// waits ms milliseconds, giving the time to the idle callback
+// if there is one:
+
+void SonMicroReader::wait(unsigned long ms)
+{
+  if (idleCallback == NULL) {
+    delay(ms);
+    return;
+  }
+  unsigned long start = millis();
+  unsigned long elapsed = 0;
+  while (elapsed < ms) {
+    idleCallback(ms - elapsed);
+    elapsed = millis() - start;
+  }
+  idleTime += elapsed;
+}
+
+// writes one record to the recorder in a single write:
+//
+
+void SonMicroReader::record(byte type, const byte* packet, int length)
+{
+  byte entry[RECORD_HEADER_SIZE + BUFFER_SIZE];
+  unsigned long now = millis();
+  entry[0] = type;
+  for (int b = 0; b < 4; b++) {
+    entry[b + 1] = now >> (8 * b);
+  }
+  entry[RECORD_HEADER_SIZE - 1] = length;
+  memcpy(entry + RECORD_HEADER_SIZE, packet, length);
+  recorder->write(entry, RECORD_HEADER_SIZE + length);
+}
+
+// adds the last seek or select result to the event log.
+// When the log is full, the oldest event is dropped:
+
+void SonMicroReader::recordEvent()
+{
+  int index = (eventStart + eventCount) % EVENT_LOG_SIZE;
+  if (eventCount == EVENT_LOG_SIZE) {
+    eventStart = (eventStart + 1) % EVENT_LOG_SIZE;
+    if (eventsDropped < 255) eventsDropped++;
+  } 
+  else {
+    eventCount++;
+  }
+  ReadEvent& event = events[index];
+  event.time = millis();
+  event.tagType = selectResult.tagType;
+  event.errorCode = selectResult.status;
+  event.uidLength = selectResult.uidLength;
+  memcpy(event.uid, selectResult.uid, UID_SIZE);
+}
+
+/**
+ * Sends the logged seek and select events as one binary frame,
+ * and removes them from the log. Only as many events as fit in
+ * maxBytes, and no more than EVENTS_PER_FRAME, are sent, so you
+ * can pass Serial.availableForWrite() to send only when the serial
+ * link has room. If not even one event fits, nothing is sent.
+ *
+ * The frame is:
+ *   0x7E, number of events, number of events dropped since the last frame,
+ *   the events (EVENT_FRAME_SIZE bytes each, multi-byte values low byte first):
+ *     millis() (4 bytes), tag type, error code, UID length, UID (7 bytes)
+ *   checksum (low byte of the sum of all the bytes after the 0x7E)
+ *
+ * @param output    where to send the frame, e.g. Serial
+ * @param maxBytes  the most bytes to send
+ * @return  the number of events sent
+ */
+
+int SonMicroReader::sendEvents(Print& output, int maxBytes)
+{
+  int count = (maxBytes - 4) / EVENT_FRAME_SIZE;
+  if (count > EVENTS_PER_FRAME) count = EVENTS_PER_FRAME;
+  if (count > eventCount) count = eventCount;
+  if (count <= 0) {
+    return 0;
+  }
+  byte frame[4 + EVENTS_PER_FRAME * EVENT_FRAME_SIZE];
+  int length = 0;
+  frame[length++] = 0x7E;
+  frame[length++] = count;
+  frame[length++] = eventsDropped;
+  for (int i = 0; i < count; i++) {
+    ReadEvent& event = events[(eventStart + i) % EVENT_LOG_SIZE];
+    for (int b = 0; b < 4; b++) {
+      frame[length++] = event.time >> (8 * b);
+    }
+    frame[length++] = event.tagType;
+    frame[length++] = event.errorCode;
+    frame[length++] = event.uidLength;
+    memcpy(frame + length, event.uid, UID_SIZE);
+    length += UID_SIZE;
+  }
+  byte frameChecksum = 0;
+  for (int i = 1; i < length; i++) {
+    frameChecksum += frame[i];
+  }
+  frame[length++] = frameChecksum;
+  output.write(frame, length);
+
+  eventStart = (eventStart + count) % EVENT_LOG_SIZE;
+  eventCount -= count;
+  eventsDropped = 0;
+  return count;
+}
+
 //	Clears the response buffer
 //
 
@@ -740,10 +1338,13 @@ String SonMicroReader::getNDEFpayload(int startBlock, int authentication, int* t
         thisString += (char) responseBuffer[j];
       }
     }
+    if (length <= 0) {
+      break;
+    }
     
     // Move on to the next block
     currentBlock++;
-    if ((currentBlock + 1) % 4 == 0) { // Skip security blocks
+    if (isSectorTrailer(currentBlock)) { // Skip security blocks
       currentBlock++;
         
       // If we cross a sector boundary, we need to authenticate
@@ -751,21 +1352,32 @@ String SonMicroReader::getNDEFpayload(int startBlock, int authentication, int* t
       //
       if (!authenticate(currentBlock, authentication, thisKey)) {
         thisString = "Error: could not authenticate against sector: ";
-        thisString += (int) currentBlock;
+        thisString += (int) getSector(currentBlock);
         return thisString;
       }
     }
     
     // Read the block.
-    readBlock(currentBlock);
+    if (readBlock(currentBlock) == 0) {
+      thisString = "Error: could not read block ";
+      thisString += (int) currentBlock;
+      return thisString;
+    }
     startByte = 3;  // offset of payload in next subsequent block responses
   }
   return thisString;
 }
 
 
+/**
+ * Returns the NDEF payload from the first NDEF sector listed
+ * in the tag's MAD. See findNDEFSectors().
+ */
 
-
-
-
-
+String SonMicroReader::getNDEFpayload(int authentication, int* thisKey) {
+  byte sector;
+  if (findNDEFSectors(&sector, 1) == 0) {
+    return "Error: no NDEF sectors in MAD";
+  }
+  return getNDEFpayload(getSectorStart(sector), authentication, thisKey);
+}
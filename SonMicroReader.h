@@ -24,7 +24,12 @@ published by the Free Software Foundation.
 #include "Wire.h"
 
 #define BUFFER_SIZE 24
+#define STARTUP_TIMEOUT 2000			// longest begin() waits for the reader, in ms
 #define BLOCK_SIZE 16
+#define SM13X_PAGE_SIZE 4				// Mifare Ultralight pages are 4 bytes
+
+#define SM13X_ADDRESS 0x42				// I2C address of the reader
+#define RECORD_HEADER_SIZE 6			// bytes before the packet in a recorded exchange
 
 // commands for RFID reader:
 #define SM13X_RESET 0x80  
@@ -33,11 +38,121 @@ published by the Free Software Foundation.
 #define SM13X_SELECT 0x83
 #define SM13X_AUTHENTICATE 0x85
 #define SM13X_READ 0x86
+#define SM13X_WRITE_FOUR_BYTE 0x8B
 #define SM13X_SET_ANTENNA_POWER 0x90
 #define SM13X_SET_BAUDRATE 0x94
 #define SM13X_SLEEP 0x96
 
+// tag types (see SM130 datasheet sec. 5.3):
+#define SM13X_TAG_ULTRALIGHT 0x01
+#define SM13X_TAG_CLASSIC_1K 0x02
+#define SM13X_TAG_CLASSIC_4K 0x03
+
+// authentication types for authenticate():
+#define SM13X_KEY_A 0xAA				// use the key A you send
+#define SM13X_KEY_B 0xBB				// use the key B you send
+#define SM13X_KEY_TRANSPORT 0xFF		// use the default transport key
+
+// Mifare Application Directory (MAD):
+#define MAX_SECTORS 40					// sectors on a Classic 4K
+#define NDEF_AID 0xE103					// MAD application ID for NDEF sectors
+
+// status codes returned by the reader in the third byte
+// of short responses (see SM130 datasheet sec. 5).
+// The same code can mean different things for different commands:
+enum SM13XStatus {
+	SM13X_STATUS_OK = 0x00,				// good read, or no status in the response
+	SM13X_STATUS_INVALID_KEY = 0x45,	// 'E' invalid key format in EEPROM
+	SM13X_STATUS_FAILED = 0x46,			// 'F' read or write failed
+	SM13X_STATUS_NOT_VALUE_BLOCK = 0x49,	// 'I' block is not a value block
+	SM13X_STATUS_SUCCESS = 0x4C,		// 'L' login, master key or baud rate succeeded
+	SM13X_STATUS_NO_TAG = 0x4E,			// 'N' no tag present, or login failed
+	SM13X_STATUS_RF_OFF = 0x55,			// 'U' RF field off, login failed or verify mismatch
+	SM13X_STATUS_PROTECTED = 0x58		// 'X' block is write protected
+};
+
+#define UID_SIZE 7
+
+// result of the last seek or select command:
+struct SelectResult {
+	SM13XStatus status;					// SM13X_STATUS_OK if a tag was found
+	byte tagType;						// the type of tag (see getTagType())
+	byte uidLength;						// the number of bytes in uid
+	byte uid[UID_SIZE];					// the tag's UID, as sent by the reader
+	unsigned long tagNumber;			// the tag number, low four bytes of the UID
+};
+
+// result of the last read block command:
+struct ReadResult {
+	SM13XStatus status;					// SM13X_STATUS_OK if the read succeeded
+	byte block;							// the block that was read
+	byte data[BLOCK_SIZE];				// the contents of the block
+};
+
+// result of the last authenticate command:
+struct AuthResult {
+	SM13XStatus status;					// SM13X_STATUS_SUCCESS if the login worked
+	byte block;							// the block that was authenticated
+};
+
+// number of seek and select events kept for sendEvents().
+// Each one takes sizeof(ReadEvent) bytes of RAM (14 on AVR),
+// and there can be no more than 255:
+#define EVENT_LOG_SIZE 8
+#define EVENT_FRAME_SIZE 14				// bytes per event sent by sendEvents()
+#define EVENTS_PER_FRAME 4				// most events in one frame, 60 bytes in all
+
+// one seek or select result in the event log:
+struct ReadEvent {
+	unsigned long time;					// millis() when the response came in
+	byte tagType;						// the type of tag, 0 if none
+	byte errorCode;						// the reader status (see SM13XStatus)
+	byte uidLength;						// the number of bytes in uid
+	byte uid[UID_SIZE];					// the tag's UID
+};
+
+
+// where commands go and responses come from:
+class SM13XTransport 
+{
+  public:
+	virtual void send(const byte* packet, int length) = 0;	// sends a command packet
+	virtual int receive(byte* buffer, int length) = 0;	// gets a response, returns its length
+	virtual int responseTime() {return 0;};			// ms to wait before receive()
+};
+
+// the reader, over I2C. This is the default transport:
+class SM13XWire : public SM13XTransport 
+{
+  public:
+	void send(const byte* packet, int length);
+	int receive(byte* buffer, int length);
+	int responseTime() {return 50;};		// the reader can't respond in less than 50 ms
+};
+
+// plays back a log written with setRecorder(), as fast as it can be read:
+class SM13XReplay : public SM13XTransport 
+{
+  public:
+	SM13XReplay(Stream& thisLog);
+	void send(const byte* packet, int length);
+	int receive(byte* buffer, int length);
+	int responseTime() {return waitTime;};
+	void setResponseTime(int ms);		// ms to wait before each response, 0 by default
+	unsigned long getMismatches() {return mismatches;};	// commands that didn't match the log
+	void setSkipCommands(boolean skip);	// true to step through responses with getData()
+	
+  private:
+	int readRecord(byte* header, byte* buffer, int length);	// reads one record
+	Stream& log;
+	int waitTime;
+	unsigned long mismatches;			// commands sent that didn't match the log
+	boolean skipCommands;				// skip recorded commands instead of checking them
+};
 
+// called while the library waits for the reader,
+// with the number of ms left in the wait:
+typedef void (*IdleCallback)(unsigned long remaining);
 
 // library interface description
 class SonMicroReader 
@@ -54,7 +169,7 @@ class SonMicroReader
 	int getCommand();					// the value of the last command sent
 	int getPacketLength();				// the length of the last packet received
 	int getCheckSum();					// the checksum of the last packet received
-	char* getPayload() {return payload;};	// the payload of the last packet
+	char* getPayload() {return (char*)readResult.data;};	// the payload of the last packet
 	String& getString();						// the payload as a String
 	unsigned long getTagNumber();			// the last tag number read
 	int getTagType();						// the last tag type (see SM130 datasheet sec. 5.3)
@@ -62,6 +177,7 @@ class SonMicroReader
 	int getAntennaPower();					// the antenna power (0 or 1)
 	void reset();							// resets the unit
 	String getFirmwareVersion();			// returns the firmware version
+	unsigned long getStartupTime() {return startupTime;};	// ms begin() waited for the reader
 	void seekTag();							// starts a seek command
 	unsigned long selectTag();				// starts a select command
 	boolean authenticate(int thisBlock);						// authenticates using default auth
@@ -69,13 +185,40 @@ class SonMicroReader
 	boolean authenticate(int thisBlock, int authentication, int* thisKey);	// custom auth
 	int readBlock(int block);								// reads a block  (must auth first)
 	void writeBlock(int thisBlock, String thisMessage);		// writes a block (must auth first)
-	void writeFourByteBlock(int thisBlock, String thisMessage);	// writes 4-byte block (must auth first)
+	boolean writeFourByteBlock(int thisBlock, String thisMessage);	// writes a 4-byte Ultralight page
+	int dumpUltralight(byte* buffer, int length);	// reads the first length bytes of an Ultralight
 	void setAntennaPower(int level);		// sets antenna power
 	void sleep();							// puts unit to sleep
 	void setBaudRate(int baudRate);			// sets serial baud rate
 	String getNDEFpayload(int startBlock, int authentication, int* thisKey);	// returns NDEF payload
+	String getNDEFpayload(int authentication, int* thisKey);	// finds the NDEF sector in the MAD
+	int findNDEFSectors(byte* sectors, int maxSectors);	// lists the NDEF sectors in the MAD
+	int getEventCount() {return eventCount;};	// the number of logged seek and select events
+	int sendEvents(Print& output, int maxBytes);	// sends logged events as a binary frame
+	void setRecorder(Print* log);			// records all commands and responses to log
+	void setTransport(SM13XTransport* thisTransport);	// e.g. an SM13XReplay instead of the reader
+	int getData();						// waits for response from the reader, or the next in a replay
+	void setIdleCallback(IdleCallback callback);	// called while waiting for the reader
+	boolean confirmTag(const SelectResult& tag);	// cheaply checks a tag is still there
+	unsigned long getIdleTime() {return idleTime;};	// total ms given to the idle callback
+	int getSector(int block);				// the sector a block is in, for the selected tag
+	int getSectorStart(int sector);			// the first block of a sector
+	int getSectorSize(int sector);			// the number of blocks in a sector
+	boolean isSectorTrailer(int block);		// true if block holds a sector's keys
+	const SelectResult& getSelectResult() {return selectResult;};	// result of the last seek or select
+	const ReadResult& getReadResult() {return readResult;};		// result of the last read block
+	const AuthResult& getAuthResult() {return authResult;};		// result of the last authenticate
 	
 private:
+	// decodes the response to one command into the results below:
+	typedef void (SonMicroReader::*Decoder)(void);
+	struct ResponseDecoder {
+		byte command;
+		Decoder decode;
+	};
+	static const ResponseDecoder decoders[];
+	
+
 	 int command;               		// received command, from the packet    
 	 int packetLength;          		// length of the response, from the packet
 	 int checksum;              		// checksum value received
@@ -83,17 +226,70 @@ private:
 	 int tagType;               		// the type of tag
 	 int errorCode;             		// error code from some commands
 	 String version;          			// the firmware version
+	 unsigned long startupTime;			// ms from reset until the reader answered
+	 SM13XWire wireTransport;			// the reader, over I2C
+	 SM13XTransport* transport;			// where commands and responses go
+	 Print* recorder;					// where to record them, or NULL
+	 IdleCallback idleCallback;			// called while waiting, or NULL
+	 unsigned long idleTime;			// total ms given to idleCallback
 	 int antennaPower;          		// antenna power level
 	 byte responseBuffer[BUFFER_SIZE];	// To hold the last response from the reader
-	 char payload[BLOCK_SIZE];			// payload for read and write blocks		
+	 SelectResult selectResult;			// the last seek or select response
+	 ReadResult readResult;				// the last read block response, and payload for read blocks
+	 AuthResult authResult;				// the last authenticate response
+	 byte madUid[UID_SIZE];				// UID of the tag whose MAD is cached
+	 byte madUidLength;					// length of madUid, 0 if nothing is cached
+	 byte madSectors[(MAX_SECTORS + 7) / 8];	// bit for each NDEF sector in the cached MAD
+	 ReadEvent events[EVENT_LOG_SIZE];	// ring buffer of seek and select events
+	 byte eventStart;					// index of the oldest event
+	 byte eventCount;					// number of events in the log
+	 byte eventsDropped;				// events overwritten since the last sendEvents()
 	 String payloadString;				// String version of the payload
 		
-	int getData();						// waits for response from the reader
+	void waitForReader();				// resets and waits until the reader answers
+	void record(byte type, const byte* packet, int length);	// writes one record to the recorder
+	void wait(unsigned long ms);		// waits, calling idleCallback if there is one
+	int receiveResponse(int length);	// waits for and reads up to length bytes of a response
+	void decodeFirmware();				// decodes a get firmware response
+	void decodeTag();					// decodes a seek or select response
+	void decodeAuth();					// decodes an authenticate response
+	void decodeRead();					// decodes a read block response
+	void decodeAntenna();				// decodes a set antenna power response
+	boolean readMAD();					// reads and caches the selected tag's MAD
+	boolean readMADSector(int firstBlock, int blockCount, int firstSector);	// reads one MAD sector
+	boolean wakeTag();					// selects the tag again after a failed login
+	void recordEvent();					// logs the last seek or select result
 	void clearBuffer();					// clears response buffer
 	void clearValues();					// clears private variables
 	void printBuffer(int count);		// for debugging only; prints buffer
 
  };
 
+// events from SM13XPresence::update():
+#define PRESENCE_NONE 0
+#define PRESENCE_ARRIVED 1
+#define PRESENCE_DEPARTED 2
+
+// tracks whether a tag is on the reader, re-confirming it
+// cheaply rather than selecting it again on every poll:
+class SM13XPresence 
+{
+  public:
+	SM13XPresence(SonMicroReader& thisReader);
+	int update();						// checks for a tag, returns a PRESENCE_ event
+	void setDebounce(unsigned long ms);	// ms a tag must be gone to depart, 250 by default
+	boolean isPresent() {return present;};	// true while a tag is on the reader
+	const SelectResult& getTag() {return tag;};	// the tag that's present, or last departed
+	
+  private:
+	SonMicroReader& reader;
+	SelectResult tag;					// the tag being tracked
+	SelectResult pendingTag;			// a new tag, to report next update()
+	boolean present;					// true while the tag is on the reader
+	boolean arrivalPending;				// a new tag was selected, report it next update()
+	unsigned long debounce;				// ms a tag must be gone to depart
+	unsigned long lastSeen;				// millis() when the tag was last confirmed
+};
+
 #endif
 
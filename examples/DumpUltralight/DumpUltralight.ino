@@ -0,0 +1,47 @@
+/*
+ RFID Dump Ultralight
+ 
+ Reads the whole 64 bytes of a Mifare Ultralight tag
+ using a SonMicro SM130 RFID reader, and prints them
+ four bytes (one page) per line.
+ Ultralight tags don't need authentication.
+ 
+ Circuit:
+ * SM130  attached to pins A4 and A5 (SDA and SCL)
+ 
+ This code is in the public domain
+ */
+
+#include <Wire.h>                // reader needs the Wire library
+#include <SonMicroReader.h>      
+
+SonMicroReader Rfid;            // instance of the reader library
+
+byte card[64];                  // the contents of the tag
+
+void setup() {
+  // initalize serial communications and the reader:
+  Serial.begin(9600); 
+  Rfid.begin();
+}
+
+
+void loop() {
+  // look for a tag:
+  unsigned long tag = Rfid.selectTag();
+  // if you get an Ultralight, dump it:
+  if (tag != 0 && Rfid.getTagType() == SM13X_TAG_ULTRALIGHT) {
+    Serial.print("Read a tag: ");
+    Serial.println(tag, HEX);
+    int count = Rfid.dumpUltralight(card, sizeof(card));
+    for (int i = 0; i < count; i++) {
+      Serial.print(card[i], HEX);
+      Serial.print(" ");
+      // print a newline after each page:
+      if (i % 4 == 3) {
+        Serial.println();
+      }
+    }
+    Serial.println();
+  }
+}
@@ -20,9 +20,11 @@ SonMicroReader Rfid;            // instance of the reader library
 void setup() {
   // initialize serial:
   Serial.begin(9600);
-  // initialize the reader:
+  // initialize the reader. This waits until the reader answers:
   Rfid.begin();
-  delay(2000);
+  Serial.print("Reader ready after ");
+  Serial.print(Rfid.getStartupTime());
+  Serial.println(" ms");
   
   // try to read a tag:
   Rfid.selectTag();
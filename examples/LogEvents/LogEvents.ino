@@ -0,0 +1,31 @@
+/*
+ RFID Log Events
+ 
+ Selects tags as fast as it can using a SonMicro SM130
+ RFID reader, and sends the results to the host in binary
+ frames whenever the serial port has room for them.
+ See sendEvents() in SonMicroReader.cpp for the frame format.
+ 
+ Circuit:
+ * SM130  attached to pins A4 and A5 (SDA and SCL)
+ 
+ This code is in the public domain
+ */
+
+#include <Wire.h>                // reader needs the Wire library
+#include <SonMicroReader.h>
+
+SonMicroReader Rfid;            // instance of the reader library
+
+void setup() {
+  // initalize serial communications and the reader:
+  Serial.begin(115200); 
+  Rfid.begin();
+}
+
+void loop() {
+  // each select is logged by the library:
+  Rfid.selectTag();
+  // send whatever fits in the serial transmit buffer:
+  Rfid.sendEvents(Serial, Serial.availableForWrite());
+}
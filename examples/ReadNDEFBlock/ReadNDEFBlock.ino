@@ -1,12 +1,10 @@
 /*
  RFID Read NDEF Block
  
- BRIAN REWRITE THIS
- 
- Reads block 4 of memory from a Mifare RFID tag
+ Reads the NDEF payload from a Mifare Classic RFID tag
  using a SonMicro SM130 RFID reader.
- This assumes block 4 has been written to already,
- and is using the default authentication methiof
+ The library finds the NDEF sector using the tag's
+ Mifare Application Directory (MAD), and reads it using key B
  
  Circuit:
  * SM130  attached to pins A4 and A5 (SDA and SCL)
@@ -22,10 +20,6 @@
 
 SonMicroReader Rfid;            // instance of the reader library
 
-
-int payloadSector = 1; // which sector to read
-int payloadBlock  = payloadSector * 4;
-
 void setup() {
   // initalize serial communications and the reader:
   Serial.begin(9600); 
@@ -40,14 +34,13 @@ void loop() {
   if (tag != 0) {
     Serial.print("Read a tag: ");
     Serial.println(tag, HEX);
-    // attempt to authenticate block 4:
+    // the key for the NDEF sectors:
     int key[6] = { 
       0xFF,0xFF,0xFF,0xFF,0xFF,0xFF    };
-    int authmode = 0xBB;
+    int authmode = SM13X_KEY_B;
     
-    Serial.println("authenticated successfully");
-    // Read the payload contained in this sector.
-    String payload = Rfid.getNDEFpayload(payloadBlock, authmode, key);
+    // Read the payload from the first NDEF sector in the MAD:
+    String payload = Rfid.getNDEFpayload(authmode, key);
     if (payload.length() > 0) {
       // Return the payload to the client
       Serial.print(payload); 
@@ -0,0 +1,138 @@
+/*
+ RFID Replay Benchmark
+
+ Plays back a log of reader traffic, and reports how fast
+ the library decodes it. Send the log over the serial port;
+ it's kept in memory, so the timing doesn't include the serial link.
+
+ Then it plays the log back at the reader's speed, with the same
+ work to do for each response: once doing the work after each
+ response, and once doing it in an idle callback while the library
+ waits. The difference in time is what the callback gives back.
+
+ To make a log, record a running reader, e.g. to an SD card file:
+   Rfid.setRecorder(&logFile);
+
+ No reader is needed to play a log back.
+
+ This code is in the public domain
+ */
+
+#include <Wire.h>                // reader needs the Wire library
+#include <SonMicroReader.h>
+
+// a Stream that reads the log from memory:
+class LogBuffer : public Stream {
+public:
+  byte data[512];               // the log
+  int length = 0;               // bytes in the log
+  int position = 0;             // next byte to read
+
+  int available() { return length - position; }
+  int read() { return position < length ? data[position++] : -1; }
+  int peek() { return position < length ? data[position] : -1; }
+  size_t write(uint8_t thisByte) { return 0; }
+};
+
+SonMicroReader Rfid;            // instance of the reader library
+LogBuffer logBuffer;            // the log, in memory
+SM13XReplay replay(logBuffer);  // plays back the log
+
+const int passes = 100;         // times to play the log back
+const int workPerResponse = 2000;   // units of work to do for each response
+
+volatile unsigned long workDone = 0;  // units of work done so far
+int workLeft = 0;               // units of work left for this response
+unsigned long idleMicros = 0;   // microseconds spent in onIdle()
+
+// one unit of work, standing in for a display refresh or the like:
+void doWork() {
+  for (int i = 0; i < 10; i++) {
+    workDone++;
+  }
+  workLeft--;
+}
+
+// called by the library while it waits for the reader:
+void onIdle(unsigned long remaining) {
+  if (workLeft > 0) {
+    unsigned long start = micros();
+    doWork();
+    idleMicros += micros() - start;
+  }
+}
+
+// plays the log back once at the reader's speed, doing the work
+// for each response, and returns how long that took in ms:
+unsigned long playWithWork() {
+  unsigned long start = millis();
+  logBuffer.position = 0;
+  while (logBuffer.available() > 0) {
+    workLeft = workPerResponse;
+    Rfid.getData();
+    // do whatever work the idle callback didn't:
+    while (workLeft > 0) {
+      doWork();
+    }
+  }
+  return millis() - start;
+}
+
+void setup() {
+  // initalize serial communications:
+  Serial.begin(115200);
+  Serial.setTimeout(1000);
+  // read the log, until nothing comes for a second:
+  logBuffer.length = Serial.readBytes(logBuffer.data, sizeof(logBuffer.data));
+  Serial.print(logBuffer.length);
+  Serial.println(" bytes of log");
+  if (logBuffer.length == 0) {
+    return;
+  }
+
+  // take responses from the log instead of the reader,
+  // and step through all of them with getData():
+  Rfid.setTransport(&replay);
+  replay.setSkipCommands(true);
+
+  unsigned long responses = 0;
+  unsigned long start = micros();
+  for (int pass = 0; pass < passes; pass++) {
+    logBuffer.position = 0;
+    while (logBuffer.available() > 0) {
+      Rfid.getData();
+      // read blocks are turned into Strings too:
+      if (Rfid.getCommand() == SM13X_READ) {
+        Rfid.getString();
+      }
+      responses++;
+    }
+  }
+  unsigned long decodeTime = micros() - start;
+
+  Serial.print(responses);
+  Serial.print(" responses, ");
+  Serial.print(decodeTime / responses);
+  Serial.println(" us per response");
+
+  // now wait like the reader does:
+  replay.setResponseTime(50);
+  unsigned long withoutCallback = playWithWork();
+  Rfid.setIdleCallback(onIdle);
+  unsigned long withCallback = playWithWork();
+
+  Serial.print("without idle callback: ");
+  Serial.print(withoutCallback);
+  Serial.println(" ms");
+  Serial.print("with idle callback: ");
+  Serial.print(withCallback);
+  Serial.print(" ms, ");
+  Serial.print(idleMicros / 1000);
+  Serial.println(" ms of it working in onIdle()");
+  Serial.print("time given back: ");
+  Serial.print((long)(withoutCallback - withCallback));
+  Serial.println(" ms");
+}
+
+void loop() {
+}
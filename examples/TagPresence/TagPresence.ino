@@ -0,0 +1,39 @@
+/*
+ RFID Tag Presence
+ 
+ Reports when a Mifare RFID tag is put on and taken off
+ a SonMicro SM130 RFID reader. While a tag stays on the reader,
+ it's only re-confirmed, not read again.
+ 
+ Circuit:
+ * SM130  attached to pins A4 and A5 (SDA and SCL)
+ 
+ This code is in the public domain
+ */
+
+#include <Wire.h>                // reader needs the Wire library
+#include <SonMicroReader.h>
+
+SonMicroReader Rfid;            // instance of the reader library
+SM13XPresence presence(Rfid);   // tracks the tag on the reader
+
+void setup() {
+  // initalize serial communications and the reader:
+  Serial.begin(9600); 
+  Rfid.begin();
+  // a tag has to be gone for half a second to count as taken off:
+  presence.setDebounce(500);
+}
+
+void loop() {
+  switch (presence.update()) {
+  case PRESENCE_ARRIVED:
+    Serial.print("tag arrived: ");
+    Serial.println(presence.getTag().tagNumber, HEX);
+    break;
+  case PRESENCE_DEPARTED:
+    Serial.print("tag departed: ");
+    Serial.println(presence.getTag().tagNumber, HEX);
+    break;
+  }
+}
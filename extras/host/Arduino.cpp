@@ -0,0 +1,30 @@
+/*
+ Host versions of the Arduino core functions SonMicroReader uses.
+*/
+
+#include "Arduino.h"
+#include "Wire.h"
+
+#include <chrono>
+#include <thread>
+
+HostSerial Serial;
+TwoWire Wire;
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+unsigned long micros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long millis()
+{
+  return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
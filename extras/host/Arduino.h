@@ -0,0 +1,109 @@
+/*
+ Just enough of the Arduino core to build SonMicroReader on a
+ Linux host, for replaying recorded reader traffic.
+ See replay.cpp.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define DEC 10
+#define HEX 16
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+inline boolean isPrintable(int c) { return c >= 32 && c < 127; }
+
+class String
+{
+  public:
+	String() {}
+	String(const char* text) : text(text) {}
+	String(int value) : text(std::to_string(value)) {}
+
+	void reserve(unsigned int size) { text.reserve(size); }
+	unsigned int length() const { return text.size(); }
+	char charAt(unsigned int index) const { return index < text.size() ? text[index] : 0; }
+	const char* c_str() const { return text.c_str(); }
+
+	String& operator+=(const String& other) { text += other.text; return *this; }
+	String& operator+=(const char* other) { text += other; return *this; }
+	String& operator+=(char c) { text += c; return *this; }
+	String& operator+=(int value) { text += std::to_string(value); return *this; }
+	bool operator==(const char* other) const { return text == other; }
+
+  private:
+	std::string text;
+};
+
+class Print
+{
+  public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t* buffer, size_t size) {
+		for (size_t i = 0; i < size; i++) write(buffer[i]);
+		return size;
+	}
+	size_t print(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+	size_t print(const String& text) { return print(text.c_str()); }
+	size_t print(unsigned long value, int base = DEC) {
+		char text[24];
+		snprintf(text, sizeof(text), base == HEX ? "%lX" : "%lu", value);
+		return print(text);
+	}
+	size_t print(int value, int base = DEC) {
+		if (base == HEX) return print((unsigned long)(unsigned int)value, HEX);
+		char text[24];
+		snprintf(text, sizeof(text), "%d", value);
+		return print(text);
+	}
+	size_t print(byte value, int base = DEC) { return print((unsigned long)value, base); }
+	size_t println() { return print("\n"); }
+	template <typename T> size_t println(T value) { return print(value) + println(); }
+	template <typename T> size_t println(T value, int base) { return print(value, base) + println(); }
+};
+
+class Stream : public Print
+{
+  public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	virtual size_t readBytes(uint8_t* buffer, size_t length) {
+		size_t count = 0;
+		while (count < length) {
+			int c = read();
+			if (c < 0) break;
+			buffer[count++] = c;
+		}
+		return count;
+	}
+};
+
+// Serial writes to stdout, and never has anything to read:
+class HostSerial : public Stream
+{
+  public:
+	void begin(unsigned long) {}
+	size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+	using Print::write;
+	int available() { return 0; }
+	int read() { return -1; }
+	int peek() { return -1; }
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ A Wire library with no reader on the other end, so that
+ SonMicroReader builds on a Linux host. Use an SM13XReplay
+ transport to give the library something to read.
+*/
+
+#ifndef Wire_h
+#define Wire_h
+
+#include "Arduino.h"
+
+class TwoWire : public Stream
+{
+  public:
+	void begin() {}
+	void begin(uint8_t) {}
+	void beginTransmission(int) {}
+	uint8_t endTransmission() { return 2; }	// address not acknowledged
+	uint8_t requestFrom(int, int) { return 0; }
+	size_t write(uint8_t) { return 1; }
+	using Print::write;
+	int available() { return 0; }
+	int read() { return -1; }
+	int peek() { return -1; }
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ SonMicroReader replay benchmark, for a Linux host
+
+ Plays back a log recorded with SonMicroReader::setRecorder()
+ through the library, and reports how long it takes per response.
+ Logs can be any size; they're read from the file as they're played.
+
+ Build and run:
+   make
+   ./sm13x_replay reader.log             decodes every response with getData(),
+                                         and getString() for read blocks
+   ./sm13x_replay --ndef reader.log      replays a log recorded by the ReadNDEFBlock
+                                         example through selectTag() and
+                                         getNDEFpayload(), checking each command
+   ./sm13x_replay --idle reader.log      plays the first 40 responses at the reader's
+                                         speed, with 20 ms of work for each: once
+                                         doing it after each response, and once in
+                                         an idle callback while the library waits
+*/
+
+#include "Arduino.h"
+#include "SonMicroReader.h"
+
+#include <chrono>
+
+// a Stream that reads a log file:
+class FileStream : public Stream
+{
+  public:
+	FileStream(FILE* thisFile) : file(thisFile) { restart(); }
+	// goes back to the start of the log:
+	void restart() {
+		fseek(file, 0, SEEK_END);
+		remaining = ftell(file);
+		fseek(file, 0, SEEK_SET);
+	}
+	int available() { return remaining > 0x7FFFFFFF ? 0x7FFFFFFF : (int)remaining; }
+	int read() {
+		int c = fgetc(file);
+		if (c != EOF) remaining--;
+		return c == EOF ? -1 : c;
+	}
+	int peek() {
+		int c = fgetc(file);
+		if (c == EOF) return -1;
+		ungetc(c, file);
+		return c;
+	}
+	size_t readBytes(uint8_t* buffer, size_t length) {
+		size_t count = fread(buffer, 1, length, file);
+		remaining -= count;
+		return count;
+	}
+	size_t write(uint8_t) { return 0; }
+	using Print::write;
+
+  private:
+	FILE* file;
+	long remaining;
+};
+
+const int idleResponses = 40;		// responses to play back with --idle
+const int workPerResponse = 20;		// ms of work to do for each response
+
+int workLeft = 0;					// ms of work left for this response
+unsigned long idleMicros = 0;		// time spent working in onIdle()
+
+// one ms of work, standing in for a display refresh or the like:
+static void doWork()
+{
+  unsigned long start = micros();
+  while (micros() - start < 1000) {
+  }
+  workLeft--;
+}
+
+// called by the library while it waits for the reader:
+static void onIdle(unsigned long remaining)
+{
+  if (workLeft > 0) {
+    unsigned long start = micros();
+    doWork();
+    idleMicros += micros() - start;
+  }
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// decodes every response in the log:
+static void decodeAll(SonMicroReader& rfid, SM13XReplay& replay, FileStream& log)
+{
+  replay.setSkipCommands(true);
+  unsigned long responses = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  while (log.available() > 0) {
+    rfid.getData();
+    // read blocks are turned into Strings too:
+    if (rfid.getCommand() == SM13X_READ) {
+      rfid.getString();
+    }
+    responses++;
+  }
+  double seconds = secondsSince(start);
+  printf("%lu responses in %.3f s, %.1f ns per response\n",
+    responses, seconds, responses ? seconds * 1e9 / responses : 0.0);
+}
+
+// replays the ReadNDEFBlock example's calls:
+static void readNDEF(SonMicroReader& rfid, SM13XReplay& replay, FileStream& log)
+{
+  int key[6] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF  };
+  unsigned long selects = 0;
+  unsigned long payloads = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  while (log.available() > 0) {
+    rfid.selectTag();
+    selects++;
+    if (rfid.getSelectResult().status == SM13X_STATUS_OK) {
+      rfid.getNDEFpayload(SM13X_KEY_B, key);
+      payloads++;
+    }
+  }
+  double seconds = secondsSince(start);
+  printf("%lu selects, %lu NDEF payloads in %.3f s, %.1f us per tag\n",
+    selects, payloads, seconds, payloads ? seconds * 1e6 / payloads : 0.0);
+  printf("%lu commands didn't match the log\n", replay.getMismatches());
+}
+
+// plays the first responses back at the reader's speed, doing the
+// work for each one, and returns how long that took in seconds:
+static double playWithWork(SonMicroReader& rfid, FileStream& log)
+{
+  log.restart();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < idleResponses && log.available() > 0; i++) {
+    workLeft = workPerResponse;
+    rfid.getData();
+    // do whatever work the idle callback didn't:
+    while (workLeft > 0) {
+      doWork();
+    }
+  }
+  return secondsSince(start);
+}
+
+// compares the time taken with and without an idle callback:
+static void compareIdle(SonMicroReader& rfid, SM13XReplay& replay, FileStream& log)
+{
+  replay.setSkipCommands(true);
+  replay.setResponseTime(50);
+  double withoutCallback = playWithWork(rfid, log);
+  rfid.setIdleCallback(onIdle);
+  double withCallback = playWithWork(rfid, log);
+  rfid.setIdleCallback(NULL);
+
+  printf("without idle callback: %.0f ms\n", withoutCallback * 1000);
+  printf("with idle callback: %.0f ms, %lu ms of it working in onIdle()\n",
+    withCallback * 1000, idleMicros / 1000);
+  printf("time given back: %.0f ms\n", (withoutCallback - withCallback) * 1000);
+}
+
+int main(int argc, char* argv[])
+{
+  const char* mode = argc == 3 ? argv[1] : "";
+  if (argc < 2 || argc > 3 ||
+    (argc == 3 && strcmp(mode, "--ndef") != 0 && strcmp(mode, "--idle") != 0)) {
+    fprintf(stderr, "usage: %s [--ndef | --idle] log\n", argv[0]);
+    return 1;
+  }
+  FILE* file = fopen(argv[argc - 1], "rb");
+  if (file == NULL) {
+    perror(argv[argc - 1]);
+    return 1;
+  }
+  static char fileBuffer[1 << 16];
+  setvbuf(file, fileBuffer, _IOFBF, sizeof(fileBuffer));
+
+  FileStream log(file);
+  SM13XReplay replay(log);
+  SonMicroReader rfid;
+  rfid.setTransport(&replay);
+
+  if (strcmp(mode, "--ndef") == 0) {
+    readNDEF(rfid, replay, log);
+  }
+  else if (strcmp(mode, "--idle") == 0) {
+    compareIdle(rfid, replay, log);
+  }
+  else {
+    decodeAll(rfid, replay, log);
+  }
+  fclose(file);
+  return 0;
+}